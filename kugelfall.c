@@ -1,5 +1,6 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/cpumask.h>
 
 #include <rtai.h>
 #include <rtai_sched.h>
@@ -7,159 +8,327 @@
 
 #include "pci20k.c"
 #include "zib1155.c"
+#include "model.c"
 
-#define PERIOD 25
 #define TIMER 1
 
-#define LARGE 13.2
-#define SMALL 4.4
-
-#define LARGE_COUNT 1400
-#define SMALL_COUNT 400
-
-#define BALL 10.0
-#define DISK 5.0
-#define TICKS 2048.0
-#define GRAVITY 9.81
-#define DEGREES 360.0
-
-#define MILLIMETERS_PER_METER 1000
-#define MILLISECONDS_PER_SECOND 1000.0
 #define NANOSECONDS_PER_MILLISECOND 1000000.0
 #define NANOSECONDS_PER_SECOND 1000000000.0
 
-#define MAX_VOLTS 10.0
-#define MIN_DISTANCE 0.1
-#define MAX_DISTANCE 0.5
-#define DISTANCE_BIAS 0.019
-
-static int mod(int a, int b) {
-	return ((a % b) + b) % b;
+#define DISTANCE_BIAS 19000
+#define MICROMETERS_PER_METER 1000000.0
+
+#define MAX_STATIONS 4
+#define COUNTER 2
+#define ADC 7
+#define OUTPUT 0xff
+#define DAC 0
+
+// One drop rig: the boards it is wired to, its channels and its calibration (bias in micrometers, init() runs without the FPU)
+struct station {
+	PCIKarte pci;
+	int zib;
+	int counter;
+	int adc;
+	int output;
+	int dac;
+	int bias;
+	float integral;
+	RT_TASK task;
+};
+
+static struct station station[MAX_STATIONS];
+
+// Station layout, configured at load time, e.g. stations=2 pci=0x320,0x340 zib=0x100,0x120 cpu=0,1
+static int stations = 1;
+static int pci[MAX_STATIONS] = { [0 ... MAX_STATIONS - 1] = PCIBaseAdr };
+static int zib[MAX_STATIONS] = { [0 ... MAX_STATIONS - 1] = ZIBBaseAdr };
+static int counter[MAX_STATIONS] = { [0 ... MAX_STATIONS - 1] = COUNTER };
+static int adc[MAX_STATIONS] = { [0 ... MAX_STATIONS - 1] = ADC };
+static int output[MAX_STATIONS] = { [0 ... MAX_STATIONS - 1] = OUTPUT };
+static int dac[MAX_STATIONS] = { [0 ... MAX_STATIONS - 1] = DAC };
+static int bias[MAX_STATIONS] = { [0 ... MAX_STATIONS - 1] = DISTANCE_BIAS };
+static int cpu[MAX_STATIONS] = { 0, 1, 2, 3 };
+
+module_param(stations, int, 0444);
+MODULE_PARM_DESC(stations, "number of stations (1 to 4)");
+module_param_array(pci, int, NULL, 0444);
+MODULE_PARM_DESC(pci, "PCI20428 base address per station");
+module_param_array(zib, int, NULL, 0444);
+MODULE_PARM_DESC(zib, "ZIB1155 base address per station");
+module_param_array(counter, int, NULL, 0444);
+MODULE_PARM_DESC(counter, "ZIB1155 counter of the disk encoder per station");
+module_param_array(adc, int, NULL, 0444);
+MODULE_PARM_DESC(adc, "PCI20428 analog input of the height sensor per station");
+module_param_array(output, int, NULL, 0444);
+MODULE_PARM_DESC(output, "value written to PCI20428 digital port 0 to release the ball per station");
+module_param_array(dac, int, NULL, 0444);
+MODULE_PARM_DESC(dac, "PCI20428 analog output driving the disk motor per station");
+module_param_array(bias, int, NULL, 0444);
+MODULE_PARM_DESC(bias, "height sensor bias in micrometers per station");
+module_param_array(cpu, int, NULL, 0444);
+MODULE_PARM_DESC(cpu, "CPU the real time task of each station runs on");
+
+// Each station owns its PCI20428, so the release writes the whole digital port and clears it again
+static void release(struct station* s) {
+	digital_ausgabe(&s->pci, 0, s->output);
+	rt_sleep(nano2count(25 * NANOSECONDS_PER_MILLISECOND));
+	digital_ausgabe(&s->pci, 0, 0x00);
 }
 
-static void release(void) {
-	digital_ausgabe(0, 0xff);
-	rt_sleep(nano2count(25 * NANOSECONDS_PER_MILLISECOND));
-	digital_ausgabe(0, 0x00);
+// Set the motor to 0 V; integer only, so it is also safe from init() and deinit()
+static void stop_motor(struct station* s) {
+	analog_ausgabe_roh(&s->pci, s->dac, ANAU_NULL);
 }
 
-static float measure_distance(void) {
-	float volts = analog_eingabe(7);
-	float distance = volts / MAX_VOLTS * (MAX_DISTANCE - MIN_DISTANCE) + MIN_DISTANCE - DISTANCE_BIAS;
+static float measure_distance(struct station* s) {
+	float volts = analog_eingabe(&s->pci, s->adc);
+	float distance = volts / MAX_VOLTS * (MAX_DISTANCE - MIN_DISTANCE) + MIN_DISTANCE - s->bias / MICROMETERS_PER_METER;
 
 	return distance;
 }
 
-static int measure_position(void) {
-	int ticks = ZIBGetCounter(2);
+static int measure_position(struct station* s) {
+	int ticks = ZIBGetCounter(s->zib, s->counter);
 	return ticks;
 }
 
-static float average(float* values, int length) {
-	float value = 0;
-	
+// Measure the height in meters averaged over several samples, storing the standard deviation of that average in sigma
+static float measure_height(struct station* s, float* sigma) {
+	float heights[HEIGHT_SAMPLES];
+
 	int i;
-	for(i = 0; i < length; i++) {
-		value += values[i];
+	for(i = 0; i < HEIGHT_SAMPLES; i++) {
+		heights[i] = measure_distance(s);
 	}
-	value /= (float) length;
 
-	return value;
+	return estimate(heights, HEIGHT_SAMPLES, HEIGHT_SIGMA_MIN, sigma);
 }
 
-// Calculate fall time in seconds, given fall height in meters
-static float fall_time(float height) {
-	return sqrt(2 * height) / sqrt(GRAVITY);
+// PI step towards the given speed, driving the motor through the station's analog output
+static void control_speed(struct station* s, float setpoint, float tps) {
+	analog_ausgabe(&s->pci, s->dac, control_volts(&s->integral, setpoint, tps));
 }
 
-// determine whether the ball can make it through a hole when falling from the given height in meters and spinning at the given ticks per second
-static int possible(float holeSize, float height, int tps) {
-	int max = holeSize / DEGREES / (BALL + DISK) * MILLIMETERS_PER_METER * GRAVITY * fall_time(height) * TICKS;
-	return tps < max;
-}
-
-#define MEASUREMENTS 10
-
 static void debug(long t) {
-	float counter[MEASUREMENTS] = { 0.0 };
+	struct station* s = &station[t];
+
+	float counts[MEASUREMENTS] = { 0.0 };
 	int index = 0;
 
-	int previous = measure_position();
+	int previous = measure_position(s);
 
 	while(1) {
-		int count = measure_position();
-		counter[index] = mod(count - previous, TICKS);
+		int count = measure_position(s);
+		counts[index] = mod(count - previous, TICKS);
 		previous = count;
 		
 		index = mod(index + 1, MEASUREMENTS);
 
-		float value = average(counter, MEASUREMENTS);
+		float value = average(counts, MEASUREMENTS);
 		value = value / ((float) PERIOD / MILLISECONDS_PER_SECOND);
 
-		float distance = measure_distance();
+		float distance = measure_distance(s);
 
-		rt_printk("%d millimeters\n", (int) (distance * MILLIMETERS_PER_METER));
-		rt_printk("%d tps\n", (int) (value));
-		rt_printk("%d ticks\n", count);
-		rt_printk("possible: small %d, large %d\n", possible(SMALL, distance, (int) value), possible(LARGE, distance, (int) value));
+		rt_printk("[%ld] %d millimeters\n", t, (int) (distance * MILLIMETERS_PER_METER));
+		rt_printk("[%ld] %d tps\n", t, (int) (value));
+		rt_printk("[%ld] %d ticks\n", t, count);
+		rt_printk("[%ld] possible: small %d, large %d\n", t, possible(SMALL, distance, (int) value), possible(LARGE, distance, (int) value));
 
-		//release();
+		//release(s);
 
 		rt_sleep(nano2count(PERIOD * NANOSECONDS_PER_MILLISECOND));
 	}
 }
 
-static void handler(long t) {
-	float height = measure_distance();
+// Run the speed controller until SETTLE_WINDOWS windows of MEASUREMENTS periods in a row averaged within tolerance of the setpoint, or give up after SETTLE_PERIODS.
+// Then hold the settled voltage and measure one more window, so the speed the drop is timed by is not changed by further corrections.
+// Returns the speed in ticks per second over that window, storing the standard deviation of that estimate in sigma and the last counter reading in count
+static float settle_speed(long t, struct station* s, float setpoint, float* sigma, int* count) {
+	float counts[MEASUREMENTS] = { 0.0 };
+	int previous = measure_position(s);
+	int steady = 0;
 
-	rt_printk("\n");
-	rt_printk("Height is %d mm\n", (int) (height * MILLIMETERS_PER_METER));
+	int i;
+	for(i = 0; i < SETTLE_PERIODS; i++) {
+		rt_sleep(nano2count(PERIOD * NANOSECONDS_PER_MILLISECOND));
 
-	float counter[MEASUREMENTS] = { 0.0 };
-	int previous = measure_position();
+		*count = measure_position(s);
+		counts[mod(i, MEASUREMENTS)] = mod(*count - previous, TICKS);
+		previous = *count;
 
-	int i;
-	for(i = 0; i < MEASUREMENTS; i++) {
+		control_speed(s, setpoint, counts[mod(i, MEASUREMENTS)] / ((float) PERIOD / MILLISECONDS_PER_SECOND));
+
+		if(mod(i, MEASUREMENTS) == MEASUREMENTS - 1) {
+			steady = steady_windows(steady, average(counts, MEASUREMENTS) / ((float) PERIOD / MILLISECONDS_PER_SECOND), setpoint);
+
+			if(steady >= SETTLE_WINDOWS) {
+				break;
+			}
+		}
+	}
+
+	analog_ausgabe(&s->pci, s->dac, hold_volts(s->integral));
+
+	int j;
+	for(j = 0; j < MEASUREMENTS; j++) {
 		rt_sleep(nano2count(PERIOD * NANOSECONDS_PER_MILLISECOND));
 
-		int count = measure_position();
-		counter[i] = mod(count - previous, TICKS);
-		previous = count;
+		*count = measure_position(s);
+		counts[j] = mod(*count - previous, TICKS);
+		previous = *count;
 	}
 
-	float tps = average(counter, MEASUREMENTS) / ((float) PERIOD / MILLISECONDS_PER_SECOND);
+	float tps = estimate(counts, MEASUREMENTS, SPEED_SIGMA_MIN * ((float) PERIOD / MILLISECONDS_PER_SECOND), sigma) / ((float) PERIOD / MILLISECONDS_PER_SECOND);
+	*sigma /= (float) PERIOD / MILLISECONDS_PER_SECOND;
 
-	rt_printk("Turn speed is %d tps\n", (int) tps);
+	rt_printk("[%ld] Turn speed is %d +- %d tps after %d periods\n", t, (int) tps, (int) *sigma, i);
 
-	if(possible(LARGE, height, (int) tps)) {
-		int count = measure_position();
+	return tps;
+}
 
-		int drop_count = mod(LARGE_COUNT - tps * fall_time(height), TICKS);
+// Sleep until the disk has turned wait_ticks past the given count, read at start.
+// The counter is read every period on the way, so only the last stretch of at most TRACK_TIME is extrapolated from the speed.
+static void wait_for_passage(struct station* s, int count, RTIME start, int wait_ticks, float tps) {
+	while(wait_ticks / tps > TRACK_TIME) {
+		rt_sleep_until(start + nano2count(PERIOD * NANOSECONDS_PER_MILLISECOND));
 
-		rt_printk("Current position is %d ticks, drop position is %d ticks\n", count, drop_count);
-		
-		int wait_ticks = mod(drop_count - count, TICKS);
+		int next = measure_position(s);
+		start = rt_get_time();
 
-		long long wait_time = (long long) ((float) wait_ticks / tps * NANOSECONDS_PER_SECOND);
+		wait_ticks -= mod(next - count, TICKS);
+		count = next;
+	}
 
-		rt_printk("Waiting %d ticks (%lld nanoseconds)\n", wait_ticks, wait_time);
+	rt_sleep_until(start + nano2count((long long) ((float) wait_ticks / tps * NANOSECONDS_PER_SECOND)));
+}
 
-		rt_sleep(nano2count(wait_time));
+static void handler(long t) {
+	struct station* s = &station[t];
 
-		count = measure_position();
-		
-		rt_printk("Dropping at %d ticks (off by %d)\n", count, count - drop_count);
+	rt_printk("\n");
 
-		release();
-	}
-	else {
-		rt_printk("Not possible\n");
+	float margin = 1;
+	float tpsSigma = SPEED_SIGMA_MIN;
+
+	// If not even the best reachable passage is likely enough, slow the disk down and try again.
+	int attempt;
+	for(attempt = 0; attempt < RETRIES; attempt++) {
+		float heightSigma;
+		float height = measure_height(s, &heightSigma);
+
+		rt_printk("[%ld] Height is %d +- %d um\n", t, (int) (height * MICROMETERS_PER_METER), (int) (heightSigma * MICROMETERS_PER_METER));
+
+		// the first attempt assumes the quantization noise of the speed estimate, retries use the spread actually measured
+		float setpoint = margin * target_speed(LARGE, height, heightSigma, tpsSigma);
+
+		rt_printk("[%ld] Target speed is %d tps\n", t, (int) setpoint);
+
+		// a height outside the sensor range (or NaN) gives no usable setpoint, and settling towards 0 tps could never succeed
+		if(!(height >= MIN_DISTANCE && height <= MAX_DISTANCE) || !(setpoint > 0)) {
+			break;
+		}
+
+		int count;
+		float tps = settle_speed(t, s, setpoint, &tpsSigma, &count);
+		RTIME start = rt_get_time();
+
+		struct passage passage = choose_passage(count, height, heightSigma, tps, tpsSigma);
+
+		if(passage.hole == NULL || passage.probability < MIN_PROBABILITY) {
+			rt_printk("[%ld] Hit probability %d%%, retrying slower\n", t, (int) (passage.probability * 100));
+			margin *= RETRY_SLOWDOWN;
+			continue;
+		}
+
+		rt_printk("[%ld] Current position is %d ticks, drop position is %d ticks through the %s hole, hit probability %d%%\n", t, count, passage.drop_count, passage.hole->name, (int) (passage.probability * 100));
+		rt_printk("[%ld] Waiting %d ticks\n", t, passage.wait_ticks);
+
+		// the wait counts from the counter reading, so the logging above comes out of the lead time instead of delaying the release
+		wait_for_passage(s, count, start, passage.wait_ticks, tps);
+
+		count = measure_position(s);
+
+		release(s);
+
+		// the disk has to keep its speed until the ball is through
+		rt_sleep(nano2count((long long) ((RELEASE_LATENCY + fall_time(height)) * NANOSECONDS_PER_SECOND)));
+
+		rt_printk("[%ld] Dropped at %d ticks (off by %d)\n", t, count, count - passage.drop_count);
+
+		stop_motor(s);
+		return;
 	}
+
+	rt_printk("[%ld] Not possible\n", t);
+
+	stop_motor(s);
 }
 
-static RT_TASK task;
+// Whether the port ranges [a, a + a_size) and [b, b + b_size) share a port
+static __init int overlaps(int a, int a_size, int b, int b_size) {
+	return a < b + b_size && b < a + a_size;
+}
+
+// Reject station layouts that would have two stations share a board or a CPU, or address channels the boards do not have
+static __init int check(void) {
+	if(stations < 1 || stations > MAX_STATIONS) {
+		rt_printk("stations must be between 1 and %d\n", MAX_STATIONS);
+		return -EINVAL;
+	}
+
+	int i, j;
+	for(i = 0; i < stations; i++) {
+		if(cpu[i] < 0 || cpu[i] >= RTAI_NR_CPUS || !cpu_online(cpu[i])) {
+			rt_printk("[%d] CPU %d is not available\n", i, cpu[i]);
+			return -EINVAL;
+		}
+		if(counter[i] < 0 || counter[i] > 3) {
+			rt_printk("[%d] counter must be between 0 and 3\n", i);
+			return -EINVAL;
+		}
+		if(adc[i] < 0 || adc[i] > 15) {
+			rt_printk("[%d] adc must be between 0 and 15\n", i);
+			return -EINVAL;
+		}
+		if(dac[i] < 0 || dac[i] > 1) {
+			rt_printk("[%d] dac must be 0 or 1\n", i);
+			return -EINVAL;
+		}
+		if(output[i] < 0 || output[i] > 0xff) {
+			rt_printk("[%d] output must be between 0x00 and 0xff\n", i);
+			return -EINVAL;
+		}
+
+		// a board decodes a whole range of ports from its base address, so no two ranges may overlap, whatever board they belong to
+		for(j = 0; j < stations; j++) {
+			if(overlaps(pci[i], PCIAdrBereich, zib[j], ZIBAdrBereich)) {
+				rt_printk("[%d] PCI20428 at 0x%x overlaps the ZIB1155 of station %d at 0x%x\n", i, pci[i], j, zib[j]);
+				return -EINVAL;
+			}
+		}
+
+		for(j = 0; j < i; j++) {
+			if(overlaps(pci[i], PCIAdrBereich, pci[j], PCIAdrBereich) || overlaps(zib[i], ZIBAdrBereich, zib[j], ZIBAdrBereich)) {
+				rt_printk("[%d] shares ports of its PCI20428 or ZIB1155 with station %d\n", i, j);
+				return -EINVAL;
+			}
+			if(cpu[i] == cpu[j]) {
+				rt_printk("[%d] shares CPU %d with station %d\n", i, cpu[i], j);
+				return -EINVAL;
+			}
+		}
+	}
+
+	return 0;
+}
 
 static __init int init(void) {
+	int error = check();
+	if(error) {
+		return error;
+	}
+
 	rt_mount();
 
 	rt_linux_use_fpu(1);
@@ -167,18 +336,41 @@ static __init int init(void) {
 	rt_set_oneshot_mode();
 	start_rt_timer(0);
 
-	rt_task_init(&task, handler, 0, 4096, 4, 1, 0);
-
-	init_pci();
-
-	rt_task_resume(&task);
+	int i;
+	for(i = 0; i < stations; i++) {
+		struct station* s = &station[i];
+
+		s->zib = zib[i];
+		s->counter = counter[i];
+		s->adc = adc[i];
+		s->output = output[i];
+		s->dac = dac[i];
+		s->bias = bias[i];
+
+		// one task per station, each pinned to its own CPU so stations do not delay each other
+		rt_task_init_cpuid(&s->task, handler, i, 4096, 4, 1, 0, cpu[i]);
+
+		if(init_pci(&s->pci, pci[i])) {
+			stop_motor(s);
+			rt_task_resume(&s->task);
+		}
+		else {
+			rt_printk("[%d] No PCI20428 at 0x%x\n", i, pci[i]);
+		}
+	}
 	
 	return 0;
 }
 
 static __exit void deinit(void) {
 	stop_rt_timer();
-	rt_task_delete(&task);
+
+	int i;
+	for(i = 0; i < stations; i++) {
+		rt_task_delete(&station[i].task);
+		stop_motor(&station[i]);
+	}
+
 	rt_umount();
 }
 
@@ -0,0 +1,285 @@
+// Drop model of the rig: geometry, timing and the hit probability of a drop.
+// Pure functions only, shared by the module and the user-space simulation; the includer provides sqrt(), exp(), fabs() and NULL.
+
+#define LARGE 13.2
+#define SMALL 4.4
+
+#define LARGE_COUNT 1400
+#define SMALL_COUNT 400
+
+#define BALL 10.0
+#define DISK 5.0
+#define TICKS 2048.0
+#define GRAVITY 9.81
+#define DEGREES 360.0
+
+#define MILLIMETERS_PER_METER 1000
+#define MILLISECONDS_PER_SECOND 1000.0
+
+// Sensors: sample period in milliseconds, samples per speed and height estimate, range of the height sensor
+#define PERIOD 25
+#define MEASUREMENTS 10
+#define HEIGHT_SAMPLES 10
+#define MAX_VOLTS 10.0
+#define MIN_DISTANCE 0.1
+#define MAX_DISTANCE 0.5
+
+// Quantization of the estimates: one step of the 12 bit ADC over +-10 V in meters, and one tick over a window of MEASUREMENTS periods in ticks per second,
+// since the counts of a window add up to the difference of two counter readings.
+// Their standard deviations: one rounded reading for the height, the difference of two rounded readings for the speed,
+// and in ticks for the position a counter reading plus the drop count rounded to whole ticks.
+#define HEIGHT_LSB (2 * MAX_VOLTS / 4096 / MAX_VOLTS * (MAX_DISTANCE - MIN_DISTANCE))
+#define SPEED_LSB (MILLISECONDS_PER_SECOND / (PERIOD * MEASUREMENTS))
+#define HEIGHT_SIGMA_MIN (HEIGHT_LSB / sqrt(12))
+#define SPEED_SIGMA_MIN (SPEED_LSB / sqrt(6))
+#define COUNT_SIGMA (1 / sqrt(6))
+
+// Hit model: delay from writing the release to the ball falling and its jitter in seconds,
+// least time in seconds between choosing a passage and writing the release (logging, scheduling),
+// longest time in seconds the release is extrapolated from a counter reading, since the wait keeps reading the counter every period,
+// probability required to drop, revolutions searched for a passage, resolution of the setpoint search
+#define RELEASE_LATENCY 0.005
+#define RELEASE_JITTER 0.0001
+#define LEAD_TIME 0.002
+#define TRACK_TIME (PERIOD / MILLISECONDS_PER_SECOND + LEAD_TIME)
+#define MIN_PROBABILITY 0.5
+#define REVOLUTIONS 2
+#define SPEED_STEPS 100
+
+// Speed controller: volts per tps of error, volts per tps of error per second, tolerance of a window average as a fraction of the setpoint,
+// periods before giving up, windows of MEASUREMENTS periods in a row that have to be in tolerance.
+// KP / KI is the motor time constant the simulation assumes (0.3 s), so the integral settles on the holding voltage without overshoot.
+#define KP 0.001
+#define KI 0.0033
+#define SPEED_TOLERANCE 0.02
+#define SETTLE_PERIODS 200
+#define SETTLE_WINDOWS 2
+
+// Drop decision: speed reduction per retry, attempts before giving up
+#define RETRY_SLOWDOWN 0.9
+#define RETRIES 5
+
+static int mod(int a, int b) {
+	return ((a % b) + b) % b;
+}
+
+static float average(float* values, int length) {
+	float value = 0;
+	
+	int i;
+	for(i = 0; i < length; i++) {
+		value += values[i];
+	}
+	value /= (float) length;
+
+	return value;
+}
+
+// Calculate the standard deviation of the average of the given values
+static float deviation(float* values, int length) {
+	float mean = average(values, length);
+	float value = 0;
+
+	int i;
+	for(i = 0; i < length; i++) {
+		value += (values[i] - mean) * (values[i] - mean);
+	}
+	value /= (float) (length - 1) * length;
+
+	return sqrt(value);
+}
+
+// Average of the given values, storing the standard deviation of that average in sigma but never less than minimum,
+// since repeated quantized readings can all be equal without the quantity being known exactly
+static float estimate(float* values, int length, float minimum, float* sigma) {
+	*sigma = deviation(values, length);
+	if(*sigma < minimum) {
+		*sigma = minimum;
+	}
+
+	return average(values, length);
+}
+
+// Probability that a normally distributed error with the given standard deviation stays within +-limit (Abramowitz and Stegun 7.1.26)
+static float within(float limit, float sigma) {
+	if(limit <= 0) {
+		return 0;
+	}
+	if(sigma <= 0) {
+		return 1;
+	}
+
+	float x = limit / (sigma * sqrt(2));
+	float k = 1 / (1 + 0.3275911 * x);
+
+	return 1 - k * (0.254829592 + k * (-0.284496736 + k * (1.421413741 + k * (-1.453152027 + k * 1.061405429)))) * exp(-x * x);
+}
+
+// PI step towards the given speed, returning the motor voltage
+static float control_volts(float* integral, float setpoint, float tps) {
+	float error = setpoint - tps;
+	float dt = (float) PERIOD / MILLISECONDS_PER_SECOND;
+
+	float volts = KP * error + KI * (*integral + error * dt);
+
+	// only integrate while the output is not saturated, so the integral does not wind up
+	if(volts > MAX_VOLTS) {
+		volts = MAX_VOLTS;
+	}
+	else if(volts < 0) {
+		volts = 0;
+	}
+	else {
+		*integral += error * dt;
+	}
+
+	return volts;
+}
+
+// The voltage to hold once the speed has settled: the integral part alone is what keeps the setpoint,
+// without the proportional reaction to the quantization and flutter of the last period
+static float hold_volts(float integral) {
+	float volts = KI * integral;
+
+	if(volts > MAX_VOLTS) {
+		volts = MAX_VOLTS;
+	}
+	else if(volts < 0) {
+		volts = 0;
+	}
+
+	return volts;
+}
+
+// Count the windows of MEASUREMENTS periods in a row whose average speed was within tolerance of the setpoint.
+// A single average can cross the tolerance mid ramp; several windows in a row within it cannot.
+static int steady_windows(int steady, float tps, float setpoint) {
+	if(fabs(tps - setpoint) < SPEED_TOLERANCE * setpoint) {
+		return steady + 1;
+	}
+
+	return 0;
+}
+
+// Calculate fall time in seconds, given fall height in meters
+static float fall_time(float height) {
+	return sqrt(2 * height) / sqrt(GRAVITY);
+}
+
+// Calculate the speed in ticks per second at which the ball just makes it through a hole when falling from the given height in meters
+static float max_speed(float holeSize, float height) {
+	return holeSize / DEGREES / (BALL + DISK) * MILLIMETERS_PER_METER * GRAVITY * fall_time(height) * TICKS;
+}
+
+// determine whether the ball can make it through a hole when falling from the given height in meters and spinning at the given ticks per second
+static int possible(float holeSize, float height, int tps) {
+	int max = max_speed(holeSize, height);
+	return tps < max;
+}
+
+// Chance that the ball makes it through a hole when the release is written the given time in seconds after the last counter reading.
+// The ball passes as long as the hole position at arrival is off by less than the slack left after the ball's transit through the disk;
+// that position is uncertain through the fall time (height noise), the speed estimate and the flutter of the disk accumulated until the ball arrives,
+// the whole ticks it is counted and aimed in, and the release jitter.
+// tpsSigma is the deviation of an average over MEASUREMENTS periods, so a single period flutters sqrt(MEASUREMENTS) times as much.
+static float hit_probability(float holeSize, float height, float heightSigma, float tps, float tpsSigma, float wait) {
+	if(!possible(holeSize, height, (int) tps)) {
+		return 0;
+	}
+
+	float period = PERIOD / MILLISECONDS_PER_SECOND;
+	float time = wait + RELEASE_LATENCY + fall_time(height);
+
+	float slack = holeSize / DEGREES * TICKS * (1 - tps / max_speed(holeSize, height));
+
+	float fallSigma = tps * fall_time(height) / (2 * height) * heightSigma;
+	float speedSigma = tpsSigma * time;
+	float flutterSigma = tpsSigma * sqrt(MEASUREMENTS) * sqrt(period * time);
+	float releaseSigma = tps * RELEASE_JITTER;
+
+	return within(slack / 2, sqrt(fallSigma * fallSigma + speedSigma * speedSigma + flutterSigma * flutterSigma + COUNT_SIGMA * COUNT_SIGMA + releaseSigma * releaseSigma));
+}
+
+// Fastest speed in ticks per second whose hit probability is at least MIN_PROBABILITY even when the release is extrapolated over the whole TRACK_TIME,
+// so the setpoint comes from the same error budget the drop decision uses. Falls back to the most likely speed if none qualifies.
+static float target_speed(float holeSize, float height, float heightSigma, float tpsSigma) {
+	float max = max_speed(holeSize, height);
+
+	float best = 0;
+	float best_probability = 0;
+
+	int i;
+	for(i = SPEED_STEPS - 1; i > 0; i--) {
+		float tps = max * i / SPEED_STEPS;
+		float probability = hit_probability(holeSize, height, heightSigma, tps, tpsSigma, TRACK_TIME);
+
+		if(probability >= MIN_PROBABILITY) {
+			return tps;
+		}
+		if(probability > best_probability) {
+			best = tps;
+			best_probability = probability;
+		}
+	}
+
+	return best;
+}
+
+// Holes in the disk: size in degrees and the count at which the hole is under the ball
+static const struct hole {
+	const char* name;
+	float size;
+	int count;
+} holes[] = { { "large", LARGE, LARGE_COUNT }, { "small", SMALL, SMALL_COUNT } };
+
+// A hole passage to drop at: ticks to wait from the current count, count to release at and the chance of a hit
+struct passage {
+	const struct hole* hole;
+	int wait_ticks;
+	int drop_count;
+	float probability;
+};
+
+// Pick the hole passage within the next REVOLUTIONS with the most expected hits per second until the ball lands.
+// Passages closer than LEAD_TIME cannot be reached any more; when the next one is too close, a later one wins.
+// Returns a passage without a hole if none can be reached or none has a chance.
+static struct passage choose_passage(int count, float height, float heightSigma, float tps, float tpsSigma) {
+	struct passage best = { NULL, 0, 0, 0 };
+	float best_rate = 0;
+
+	if(tps <= 0) {
+		return best;
+	}
+
+	float time = RELEASE_LATENCY + fall_time(height);
+
+	// the counter shows the tick the disk is in, half a tick behind on average; truncating the ticks turned during the flight
+	// and releasing one tick earlier aims half a tick ahead of the hole on average, which cancels that
+	int h;
+	for(h = 0; h < sizeof(holes) / sizeof(holes[0]); h++) {
+		int drop_count = mod(holes[h].count - (int) (tps * time) - 1, TICKS);
+
+		int k;
+		for(k = 0; k < REVOLUTIONS; k++) {
+			int wait_ticks = mod(drop_count - count, TICKS) + k * TICKS;
+			float wait = wait_ticks / tps;
+
+			if(wait < LEAD_TIME) {
+				continue;
+			}
+
+			float probability = hit_probability(holes[h].size, height, heightSigma, tps, tpsSigma, wait < TRACK_TIME ? wait : TRACK_TIME);
+			float rate = probability / (wait + time);
+
+			if(rate > best_rate) {
+				best.hole = &holes[h];
+				best.wait_ticks = wait_ticks;
+				best.drop_count = drop_count;
+				best.probability = probability;
+				best_rate = rate;
+			}
+		}
+	}
+
+	return best;
+}
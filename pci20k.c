@@ -13,16 +13,23 @@
 /*******************************************************************/
 
 #define FAKTOR  0.0048828125
+#define ANAU_NULL  0x800  /* Rohwert fuer 0 V */
 
-int board_id;
+#define PCIBaseAdr  0x320  /* Standard-Basis-Adresse */
+#define PCIAdrBereich  0x10  /* belegte Ports ab der Basis-Adresse */
 
-int base_adr;
+  /* Geraetekontext einer Karte, eine Instanz pro Karte im System */
+typedef struct
+{
+ int board_id;
+ int base_adr;
+} PCIKarte;
 
 
 /*******************************************************************/
 /* Initialisierung der E/A-Karte PCI20428 (ISA-Slot)               */
 /*                                                                 */
-/* Standard-Basis-Adresse: 0x320                                   */
+/* Standard-Basis-Adresse: 0x320 (PCIBaseAdr)                      */
 /*                                                                 */
 /* Port 0       : Digital-Eingabe (8 Bit)                          */
 /*      1       : Digital-Ausgabe (8 Bit)                          */
@@ -30,33 +37,33 @@ int base_adr;
 /*              : 2 Kanal-Analogausgabe (12 Bit Aufl.)             */
 /*              : Zaehler/Zeitgeber (16 Bit)                       */
 /*                                                                 */
-/* Aufruf       : status = init_pci();                             */
+/* Aufruf       : status = init_pci(&karte, adr);                  */
 /*                                                                 */
 /* Returnwert:  0  - Karte vorhanden                               */
 /*              1  - keine PCI20428-Karte vorhanden                */
 /*                                                                 */
 /*******************************************************************/
 
-int init_pci(void)
+int init_pci(PCIKarte *karte, int adr)
 {
- board_id = inb (0x320);
+ karte->board_id = inb (adr);
 
- switch (board_id)
+ switch (karte->board_id)
  {
   case 0xff:
-   board_id = 0;
+   karte->board_id = 0;
    return (0);
   case 0x00:
-   board_id = 0;
+   karte->board_id = 0;
    return (0);
   case 0x30:
-   base_adr = 0x320;
-   outb (0, base_adr);
-   outb (0, base_adr + 1);
-   outb (0, base_adr + 8);
+   karte->base_adr = adr;
+   outb (0, karte->base_adr);
+   outb (0, karte->base_adr + 1);
+   outb (0, karte->base_adr + 8);
    return (1);
   default:
-   board_id = 0;
+   karte->board_id = 0;
    return (0);
  }
 }
@@ -65,23 +72,23 @@ int init_pci(void)
 /*******************************************************************/
 /* Digital-Eingabe                                                 */
 /*                                                                 */
-/* Aufruf       : iwert = digital_eingabe (knr);                   */
+/* Aufruf       : iwert = digital_eingabe (&karte, knr);           */
 /*                                                                 */
 /* Returnwert:  x  - eingelesener Digitalwert                      */
 /*              -1 - keine Karte vorhanden oder falsche knr        */
 /*                                                                 */
 /*******************************************************************/
 
-int digital_eingabe (int knr)
+int digital_eingabe (PCIKarte *karte, int knr)
 {
  int dummy;
 
- switch (board_id)
+ switch (karte->board_id)
  {
   case 0x30 :
    if (knr == 0)
    {
-    dummy = inb (base_adr + 2);
+    dummy = inb (karte->base_adr + 2);
     return (dummy);
    }
   default   :
@@ -99,16 +106,16 @@ int digital_eingabe (int knr)
 /*                                                                 */
 /*******************************************************************/
 
-int digital_ausgabe (int knr, int wert)
+int digital_ausgabe (PCIKarte *karte, int knr, int wert)
 {
  int dummy;
 
- switch (board_id)
+ switch (karte->board_id)
  {
  case 0x30 :
   if (knr == 0)
   {
-   outb (wert, base_adr + 2);
+   outb (wert, karte->base_adr + 2);
    return (1);
   }
  default   :
@@ -119,30 +126,38 @@ int digital_ausgabe (int knr, int wert)
 
 
 /*******************************************************************/
+/* Analog-Ausgabe als 12-Bit-Rohwert, ohne Gleitkommarechnung      */
+/* (auch ausserhalb der RT-Tasks verwendbar)                       */
 /*                                                                 */
+/* Rohwert      : 0x000 (-10 V) .. 0xfff (+10 V - FAKTOR), Werte   */
+/*                ausserhalb werden begrenzt (0x1000 waere sonst   */
+/*                0x000, also -10 V statt +10 V)                   */
 /*                                                                 */
+/* Aufruf       : analog_ausgabe_roh (&karte, knr, ANAU_NULL);     */
 /*                                                                 */
-/*                                                                 */
+/* Returnwert:  1  - Wert ausgegeben                               */
+/*              0  - keine Karte vorhanden oder falsche knr        */
 /*                                                                 */
 /*******************************************************************/
 
-int analog_ausgabe (char knr, double wert)
+int analog_ausgabe_roh (PCIKarte *karte, char knr, int anau_wert)
 {
  char high_byte, low_byte;
- int  anau_wert;
 
- anau_wert = (int) ((wert + 10.0) / FAKTOR);
+ if (anau_wert < 0x000) anau_wert = 0x000;
+ if (anau_wert > 0xfff) anau_wert = 0xfff;
+
  low_byte  = (char) (anau_wert & 0x00ff);
  high_byte = (char) ((anau_wert >> 8) & 0x000f);
 
- switch (board_id)
+ switch (karte->board_id)
  {
  case 0x30 :
   if ((knr == 0) || (knr == 1 ))
   {
-   outb (high_byte, base_adr + 0x0d + 2*knr);
-   outb (low_byte,  base_adr + 0x0c + 2*knr);
-   outb (0, base_adr + 0x0b);
+   outb (high_byte, karte->base_adr + 0x0d + 2*knr);
+   outb (low_byte,  karte->base_adr + 0x0c + 2*knr);
+   outb (0, karte->base_adr + 0x0b);
    return (1);
   }
   else
@@ -155,6 +170,25 @@ int analog_ausgabe (char knr, double wert)
 }
 
 
+/*******************************************************************/
+/* Analog-Ausgabe einer Spannung                                   */
+/*                                                                 */
+/* Kanal knr    : 0 oder 1                                         */
+/* Wert         : -10.0 .. +10.0 Volt                              */
+/*                                                                 */
+/* Aufruf       : status = analog_ausgabe (&karte, knr, wert);     */
+/*                                                                 */
+/* Returnwert:  1  - Wert ausgegeben                               */
+/*              0  - keine Karte vorhanden oder falsche knr        */
+/*                                                                 */
+/*******************************************************************/
+
+int analog_ausgabe (PCIKarte *karte, char knr, double wert)
+{
+ return (analog_ausgabe_roh (karte, knr, (int) ((wert + 10.0) / FAKTOR)));
+}
+
+
 
 /*******************************************************************/
 /*                                                                 */
@@ -164,28 +198,28 @@ int analog_ausgabe (char knr, double wert)
 /*                                                                 */
 /*******************************************************************/
 
-double analog_eingabe (char knr)
+double analog_eingabe (PCIKarte *karte, char knr)
 {
  char   high_byte, low_byte;
  int    anei;
  double aneix;
  int    ianei;
 
- switch (board_id)
+ switch (karte->board_id)
  {
  case 0x30 :
   if (knr <= 15)
   {
-   outb (knr, base_adr + 9);
+   outb (knr, karte->base_adr + 9);
    rt_sleep (nano2count(10));
-   outb (0, base_adr + 0x0a);
+   outb (0, karte->base_adr + 0x0a);
    do
    {
     rt_sleep (nano2count(10));
    }
-   while ((inb(base_adr + 1) & 0x01) != 0x01);
-   high_byte = inb (base_adr + 0x0b) & 0x0f;
-   low_byte  = inb (base_adr + 0x0a);
+   while ((inb(karte->base_adr + 1) & 0x01) != 0x01);
+   high_byte = inb (karte->base_adr + 0x0b) & 0x0f;
+   low_byte  = inb (karte->base_adr + 0x0a);
    anei      = (((int) (high_byte)) << 8) | (((int) (low_byte)) & 0x00ff);
  
    aneix     = ((double) (anei)) * FAKTOR - 10.0;
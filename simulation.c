@@ -0,0 +1,385 @@
+// User-space check of the drop model and of handler()'s policy against a simulated plant.
+// Build and run with "make simulation"; exits non-zero if a check fails.
+
+#include <stdio.h>
+#include <math.h>
+
+#include "model.c"
+
+// Port I/O of the PCI20428 routines goes to this array instead of the hardware
+static int ports[0x400];
+
+static void outb(int value, int port) {
+	ports[port] = value & 0xff;
+}
+
+static int inb(int port) {
+	return ports[port];
+}
+
+#define rt_sleep(t)
+#define nano2count(t) (t)
+
+#include "pci20k.c"
+
+// Plant: motor in ticks per second per volt and its time constant in seconds, least time from the last counter reading to writing the release
+// (logging, scheduling) in seconds, time between two handler runs (next ball, reloading the module) in seconds
+#define MOTOR_GAIN 2000.0
+#define MOTOR_TAU 0.3
+#define OVERHEAD 0.001
+#define RELOAD 2.0
+
+// Handler runs per condition; a free running disk is anywhere between these fractions of max_speed() for the old rule
+#define CYCLES 3000
+#define SLOWEST 0.5
+#define FASTEST 1.5
+
+// Bins of predicted probability and how far the simulated hit rate may be off in each
+#define BINS 5
+#define CALIBRATION 0.1
+#define BIN_DROPS 200
+
+static int failures = 0;
+
+static void check(int condition, const char* what) {
+	if(!condition) {
+		printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+static unsigned int seed = 1;
+
+// Uniformly distributed in [0, 1)
+static double uniform(void) {
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) / (double) (1 << 24);
+}
+
+// Normally distributed with the given standard deviation (Box-Muller)
+static double normal(double sigma) {
+	double u = uniform();
+	double v = uniform();
+	return sigma * sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+}
+
+static void check_within(void) {
+	double x[] = { 0.1, 0.5, 1.0, 2.0, 3.0 };
+
+	int i;
+	for(i = 0; i < sizeof(x) / sizeof(x[0]); i++) {
+		check(fabs(within(x[i] * sqrt(2), 1) - erf(x[i])) < 1e-5, "within() matches erf()");
+	}
+
+	check(within(1, 0) == 1, "within() is certain without noise");
+	check(within(0, 1) == 0, "within() is 0 without slack");
+}
+
+static void check_estimate(void) {
+	float constant[] = { 3, 3, 3, 3 };
+	float ramp[] = { 1, 2, 3, 4 };
+	float sigma;
+
+	check(deviation(constant, 4) == 0, "deviation() of equal values is 0");
+	check(fabs(deviation(ramp, 4) - sqrt(5.0 / 12)) < 1e-6, "deviation() of 1..4 is sqrt(5/12)");
+
+	check(estimate(constant, 4, 0.5, &sigma) == 3 && sigma == 0.5, "estimate() floors the spread of equal values");
+	check(estimate(ramp, 4, 0.1, &sigma) == 2.5 && fabs(sigma - sqrt(5.0 / 12)) < 1e-6, "estimate() keeps a spread above the floor");
+}
+
+// The DAC has to see full scale for +10 V and above, not wrap around to -10 V
+static void check_analog_ausgabe(void) {
+	PCIKarte karte = { 0x30, PCIBaseAdr };
+
+	double volts[] = { -20.0, -10.0, 0.0, 10.0, 22.0 };
+	int raw[] = { 0x000, 0x000, 0x800, 0xfff, 0xfff };
+
+	int i;
+	for(i = 0; i < sizeof(volts) / sizeof(volts[0]); i++) {
+		analog_ausgabe(&karte, 0, volts[i]);
+		check(((ports[PCIBaseAdr + 0x0d] << 8) | ports[PCIBaseAdr + 0x0c]) == raw[i], "analog_ausgabe() clamps to the 12 bit range");
+	}
+}
+
+// The rig: a disk driven by a first order motor with random flutter per period, a ball at a known height, a noisy height sensor
+struct plant {
+	double position;
+	double speed;
+	double volts;
+	int driven;
+	float height;
+	float noise;
+	float flutter;
+	double time;
+};
+
+// Let the given time pass; the disk turns at the motor speed plus a fresh flutter sample for every (part of a) period
+static void advance(struct plant* p, double time) {
+	double period = PERIOD / MILLISECONDS_PER_SECOND;
+
+	while(time > 0) {
+		double step = time < period ? time : period;
+
+		if(p->driven) {
+			p->speed += (MOTOR_GAIN * p->volts - p->speed) * (1 - exp(-step / MOTOR_TAU));
+		}
+
+		p->position += (p->speed + normal(p->flutter)) * step;
+		p->time += step;
+		time -= step;
+	}
+}
+
+static int read_counter(struct plant* p) {
+	return mod(floor(p->position), TICKS);
+}
+
+static float read_height(struct plant* p) {
+	return floor((p->height + normal(p->noise * HEIGHT_LSB)) / HEIGHT_LSB) * HEIGHT_LSB;
+}
+
+// Release the ball wait seconds after the counter was read and score it from the kinematics of the fall:
+// the hole has to be under the ball from the moment the ball touches the top of the disk until it leaves the bottom
+static int drop(struct plant* p, const struct hole* hole, float wait) {
+	advance(p, (wait > OVERHEAD ? wait : OVERHEAD) + RELEASE_LATENCY + normal(RELEASE_JITTER));
+
+	double reach = (BALL + DISK) / 2 / MILLIMETERS_PER_METER;
+	double enter = sqrt(2 * (p->height - reach) / GRAVITY);
+	double leave = sqrt(2 * (p->height + reach) / GRAVITY);
+
+	advance(p, enter);
+	double first = p->position;
+	advance(p, leave - enter);
+	double last = p->position;
+
+	double half = hole->size / DEGREES * TICKS / 2;
+	double turns = floor((first - hole->count + half) / TICKS);
+	double centre = hole->count + turns * TICKS;
+
+	return first >= centre - half && last <= centre + half;
+}
+
+struct result {
+	int drops;
+	int hits;
+	double time;
+};
+
+struct calibration {
+	int drops[BINS];
+	int hits[BINS];
+	double predicted[BINS];
+};
+
+// handler() on the plant: measure the height, settle at the setpoint from target_speed(), hold and measure the speed, choose a passage,
+// retry slower while the chance is below MIN_PROBABILITY, stop the motor once the ball is through
+static void new_rule(struct plant* p, struct result* r, struct calibration* c) {
+	float period = PERIOD / MILLISECONDS_PER_SECOND;
+	float integral = 0;
+
+	float margin = 1;
+	float tpsSigma = SPEED_SIGMA_MIN;
+
+	int attempt;
+	for(attempt = 0; attempt < RETRIES; attempt++) {
+		float heights[HEIGHT_SAMPLES];
+		int i;
+		for(i = 0; i < HEIGHT_SAMPLES; i++) {
+			heights[i] = read_height(p);
+		}
+		float heightSigma;
+		float height = estimate(heights, HEIGHT_SAMPLES, HEIGHT_SIGMA_MIN, &heightSigma);
+
+		float setpoint = margin * target_speed(LARGE, height, heightSigma, tpsSigma);
+
+		if(!(height >= MIN_DISTANCE && height <= MAX_DISTANCE) || !(setpoint > 0)) {
+			break;
+		}
+
+		float counts[MEASUREMENTS] = { 0.0 };
+		int previous = read_counter(p);
+		int steady = 0;
+
+		for(i = 0; i < SETTLE_PERIODS; i++) {
+			advance(p, period);
+
+			int count = read_counter(p);
+			counts[mod(i, MEASUREMENTS)] = mod(count - previous, TICKS);
+			previous = count;
+
+			p->volts = control_volts(&integral, setpoint, counts[mod(i, MEASUREMENTS)] / period);
+
+			if(mod(i, MEASUREMENTS) == MEASUREMENTS - 1) {
+				steady = steady_windows(steady, average(counts, MEASUREMENTS) / period, setpoint);
+
+				if(steady >= SETTLE_WINDOWS) {
+					break;
+				}
+			}
+		}
+
+		// hold the settled voltage and time the drop by one more window
+		p->volts = hold_volts(integral);
+
+		for(i = 0; i < MEASUREMENTS; i++) {
+			advance(p, period);
+
+			int count = read_counter(p);
+			counts[i] = mod(count - previous, TICKS);
+			previous = count;
+		}
+
+		float tps = estimate(counts, MEASUREMENTS, SPEED_SIGMA_MIN * period, &tpsSigma) / period;
+		tpsSigma /= period;
+
+		struct passage passage = choose_passage(previous, height, heightSigma, tps, tpsSigma);
+
+		if(passage.hole == NULL || passage.probability < MIN_PROBABILITY) {
+			margin *= RETRY_SLOWDOWN;
+			continue;
+		}
+
+		// read the counter every period until the release is close, then extrapolate the rest
+		int wait_ticks = passage.wait_ticks;
+
+		while(wait_ticks / tps > TRACK_TIME) {
+			advance(p, period);
+
+			int count = read_counter(p);
+			wait_ticks -= mod(count - previous, TICKS);
+			previous = count;
+		}
+
+		int hit = drop(p, passage.hole, wait_ticks / tps);
+
+		int bin = passage.probability * BINS;
+		if(bin >= BINS) {
+			bin = BINS - 1;
+		}
+		c->drops[bin]++;
+		c->hits[bin] += hit;
+		c->predicted[bin] += passage.probability;
+
+		r->drops++;
+		r->hits += hit;
+		break;
+	}
+
+	p->volts = 0;
+}
+
+// The handler before the speed controller and the hit model: one height sample, ten periods of speed,
+// drop at the next passage of the large hole whenever possible() agrees. It gets the latency corrected aim for a fair comparison.
+static void old_rule(struct plant* p, struct result* r) {
+	float period = PERIOD / MILLISECONDS_PER_SECOND;
+
+	float height = read_height(p);
+
+	float counts[MEASUREMENTS];
+	int previous = read_counter(p);
+
+	int i;
+	for(i = 0; i < MEASUREMENTS; i++) {
+		advance(p, period);
+
+		int count = read_counter(p);
+		counts[i] = mod(count - previous, TICKS);
+		previous = count;
+	}
+
+	float tps = average(counts, MEASUREMENTS) / period;
+
+	if(!possible(LARGE, height, (int) tps)) {
+		return;
+	}
+
+	int drop_count = mod(LARGE_COUNT - tps * (RELEASE_LATENCY + fall_time(height)), TICKS);
+	int wait_ticks = mod(drop_count - read_counter(p), TICKS);
+
+	r->drops++;
+	r->hits += drop(p, &holes[0], wait_ticks / tps);
+}
+
+// Run both rules on the same conditions; the old rule meets the disk at whatever speed it happens to turn
+static void compare(float height, float noise, float flutter, struct calibration* c) {
+	struct result results[2] = { { 0 } };
+	float max = max_speed(LARGE, height);
+
+	struct plant p = { 0, 0, 0, 1, height, noise, flutter, 0 };
+
+	// every run is followed by setting up the next one; the motor coasts down meanwhile
+	int i;
+	for(i = 0; i < CYCLES; i++) {
+		new_rule(&p, &results[0], c);
+		advance(&p, RELOAD);
+	}
+	results[0].time = p.time;
+
+	struct plant q = { 0, 0, 0, 0, height, noise, flutter, 0 };
+
+	for(i = 0; i < CYCLES; i++) {
+		q.speed = (SLOWEST + uniform() * (FASTEST - SLOWEST)) * max;
+
+		old_rule(&q, &results[1]);
+		advance(&q, RELOAD);
+	}
+	results[1].time = q.time;
+
+	float rates[2];
+	for(i = 0; i < 2; i++) {
+		rates[i] = results[i].hits / results[i].time * 60;
+	}
+
+	printf("%5.2f  %4.1f  %6.0f  |  %8.2f  %5.2f  %5.2f  |  %8.2f  %5.2f  %5.2f\n",
+		height, noise, flutter,
+		rates[0], (float) results[0].drops / CYCLES, results[0].drops ? (float) results[0].hits / results[0].drops : 0,
+		rates[1], (float) results[1].drops / CYCLES, results[1].drops ? (float) results[1].hits / results[1].drops : 0);
+
+	check(rates[0] >= rates[1], "handler() scores at least as many hits per minute as the possible() rule");
+}
+
+int main(void) {
+	check_within();
+	check_estimate();
+	check_analog_ausgabe();
+
+	float heights[] = { 0.15, 0.25, 0.35, 0.45 };
+	float noises[] = { 0.5, 2.0 };
+	float flutters[] = { 10, 50, 100 };
+
+	struct calibration c = { { 0 } };
+
+	printf("                      |  handler()                 |  possible()\n");
+	printf("height  adc  flutter  |  hits/min  drops  hits   |  hits/min  drops  hits\n");
+
+	int h, n, f;
+	for(h = 0; h < sizeof(heights) / sizeof(heights[0]); h++) {
+		for(n = 0; n < sizeof(noises) / sizeof(noises[0]); n++) {
+			for(f = 0; f < sizeof(flutters) / sizeof(flutters[0]); f++) {
+				compare(heights[h], noises[n], flutters[f], &c);
+			}
+		}
+	}
+
+	// the predicted probability has to match how often the plant is actually hit
+	printf("\npredicted  hit rate  drops\n");
+
+	int i;
+	for(i = 0; i < BINS; i++) {
+		if(c.drops[i] == 0) {
+			continue;
+		}
+
+		float predicted = c.predicted[i] / c.drops[i];
+		float rate = (float) c.hits[i] / c.drops[i];
+
+		printf("%9.2f  %8.2f  %5d\n", predicted, rate, c.drops[i]);
+
+		if(c.drops[i] >= BIN_DROPS) {
+			check(fabs(predicted - rate) < CALIBRATION, "hit_probability() matches the simulated hit rate");
+		}
+	}
+
+	printf("%d failed checks\n", failures);
+	return failures != 0;
+}
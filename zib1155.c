@@ -56,14 +56,16 @@
 
 
 
-#define  ZIBBaseAdr           0x100  /* hier eventuell aendern */
-  /* Basisadresse, die auf dem Zaehlermodul eingestellt ist */
+#define  ZIBBaseAdr           0x100  /* Standardwert */
+  /* Basisadresse, die auf dem Zaehlermodul eingestellt ist; wird jeder */
+  /* Routine als 'BaseAdr' uebergeben, damit mehrere Karten moeglich sind */
 #define  ZIBCounterOffset      0x08
 #define  ZIBStatusIn           0x00
 #define  ZIBStrobeOut          0x00
 #define  ZIBCounterLSB         0x01
 #define  ZIBCodeOut            0x05
 #define  ZIBIOPort             0x06
+#define  ZIBAdrBereich        (4 * ZIBCounterOffset)  /* belegte Ports ab Basisadresse */
 
 
 
@@ -83,11 +85,11 @@ typedef enum {kleiner, gleich, groesser} ZIBRange;
 /*                                                                         */
 /* Zhler 'Nr' initialisieren                                              */
 /*                                                                         */
-/* Aufruf:          ZIBInitCounter (Nr, Einfach, TRUE);                    */
-/*                  ZIBInitCounter (3, Vierfach, FALSE);                   */
+/* Aufruf:          ZIBInitCounter (adr, Nr, Einfach, TRUE);               */
+/*                  ZIBInitCounter (ZIBBaseAdr, 3, Vierfach, FALSE);       */
 /*                                                                         */
 /***************************************************************************/
-void ZIBInitCounter (char Nr, ZIBCounterMode Mode, char Hysterese)
+void ZIBInitCounter (int BaseAdr, char Nr, ZIBCounterMode Mode, char Hysterese)
 {
    char CodeByte;
 
@@ -108,7 +110,7 @@ void ZIBInitCounter (char Nr, ZIBCounterMode Mode, char Hysterese)
      CodeByte |= 0x60;
 
 						/* Ausgabe an Register     */
-  outb (CodeByte, ZIBBaseAdr + Nr * ZIBCounterOffset + ZIBCodeOut);
+  outb (CodeByte, BaseAdr + Nr * ZIBCounterOffset + ZIBCodeOut);
 }
 
 
@@ -123,11 +125,11 @@ void ZIBInitCounter (char Nr, ZIBCounterMode Mode, char Hysterese)
 /* Das Auslesen der vier Bytes erfolgt gleichzeitig, es entstehen dabei    */
 /* also keine Fehler durch weiter eintreffende Impulse.                    */
 /*                                                                         */
-/* Aufruf:          asdf = ZIBGetCounter (ctr);                            */
-/*                  asdf = ZIBSetCounter (3);                              */
+/* Aufruf:          asdf = ZIBGetCounter (adr, ctr);                       */
+/*                  asdf = ZIBGetCounter (ZIBBaseAdr, 3);                  */
 /*                                                                         */
 /***************************************************************************/
-unsigned long int ZIBGetCounter (char Nr)
+unsigned long int ZIBGetCounter (int BaseAdr, char Nr)
 {
    int i;
    unsigned long int Temp;
@@ -137,12 +139,12 @@ unsigned long int ZIBGetCounter (char Nr)
 
    						/* Zaehlerstand in ber-   */
 			 			/* gaberegister sicher     */
-   outb (0, ZIBBaseAdr + Nr*ZIBCounterOffset + ZIBStrobeOut);
+   outb (0, BaseAdr + Nr*ZIBCounterOffset + ZIBStrobeOut);
 
    Temp = 0;					/* Zhlerstnde aus ber-  */
    for (i = 3; i >= 0; i--)			/* register auslese        */
    {
-      Temp += inb (ZIBBaseAdr + Nr*ZIBCounterOffset + ZIBCounterLSB + i);
+      Temp += inb (BaseAdr + Nr*ZIBCounterOffset + ZIBCounterLSB + i);
       if (i > 0)
          Temp <<= 8;  				/* Multiplikation mit 256  */
    }
@@ -162,11 +164,11 @@ unsigned long int ZIBGetCounter (char Nr)
 /* Bytes geschrieben. Dies ist zu beachten, wenn whrend der Ausfhrung    */
 /* des Befehls Zhlimpulse eintreffen!                                     */
 /*                                                                         */
-/* Aufruf:          ZIBSetCounter (ctr, count);                            */
-/*                  ZIBSetCounter (3, 100);                                */
+/* Aufruf:          ZIBSetCounter (adr, ctr, count);                       */
+/*                  ZIBSetCounter (ZIBBaseAdr, 3, 100);                    */
 /*                                                                         */
 /***************************************************************************/
-void ZIBSetCounter (char Nr, unsigned long int SetTo)
+void ZIBSetCounter (int BaseAdr, char Nr, unsigned long int SetTo)
 {
    int i;
 
@@ -175,7 +177,7 @@ void ZIBSetCounter (char Nr, unsigned long int SetTo)
 
    for (i = 3; i >= 0; i--)			/* ausgeben der vier Bytes */
       outb ((char) (SetTo >> (8*i)),
-            ZIBBaseAdr + Nr*ZIBCounterOffset + ZIBCounterLSB+i);
+            BaseAdr + Nr*ZIBCounterOffset + ZIBCounterLSB+i);
 }
 
 
@@ -189,16 +191,16 @@ void ZIBSetCounter (char Nr, unsigned long int SetTo)
 /*                                                                         */
 /* Liest ein 8-Bit-Wert von der Digitaleingabe mit der Kanalnummer 'Nr'    */
 /*                                                                         */
-/* Aufruf:          ewert = ZIBGetPort8 (KNR);                             */
-/*                  ewert = ZIBGetPort8 (1);                               */
+/* Aufruf:          ewert = ZIBGetPort8 (adr, KNR);                        */
+/*                  ewert = ZIBGetPort8 (ZIBBaseAdr, 1);                   */
 /*                                                                         */
 /***************************************************************************/
-char ZIBGetPort8 (char Nr)
+char ZIBGetPort8 (int BaseAdr, char Nr)
 {
    if (Nr > 1)  				/* Nur 0/1 mglich         */
       return (0);
 
-   return( inb (ZIBBaseAdr + ZIBIOPort + Nr));	/* Eingaberegister lesen   */  
+   return( inb (BaseAdr + ZIBIOPort + Nr));	/* Eingaberegister lesen   */  
 }
 
 
@@ -213,16 +215,16 @@ char ZIBGetPort8 (char Nr)
 /* Setzt ein 8-Bit-Wert der Digitalausgabe der Kanalnummer 'Nr'		   */
 /* mit dem Byte-Wert 'SetTo'      					   */ 
 /*                                                                         */
-/* Aufruf:          ZIBSetPort8 (KNR, abcd);                               */
-/*                  ZIBSetPort8 (1, 0xaa);                                 */
+/* Aufruf:          ZIBSetPort8 (adr, KNR, abcd);                          */
+/*                  ZIBSetPort8 (ZIBBaseAdr, 1, 0xaa);                     */
 /*                                                                         */
 /***************************************************************************/
-void ZIBSetPort8 (char Nr, char SetTo)
+void ZIBSetPort8 (int BaseAdr, char Nr, char SetTo)
 {
    if( Nr > 1 )   				/* Nur 0/1 mglich         */
       return;
    
-   outb (SetTo, ZIBBaseAdr + ZIBIOPort + Nr);
+   outb (SetTo, BaseAdr + ZIBIOPort + Nr);
 }
 
 
@@ -237,12 +239,12 @@ void ZIBSetPort8 (char Nr, char SetTo)
 /* Liest die beiden 8-Bit-Ports der Digitaleingabe als Integerwert 'abcd'  */
 /* Erst wird das hterwertige, dann das niederwertige Byte eingelesen!     */
 /*                                                                         */
-/* Aufruf:          abcd = ZIBGetPort16 ();                                */
+/* Aufruf:          abcd = ZIBGetPort16 (adr);                             */
 /*                                                                         */
 /***************************************************************************/
-int ZIBGetPort16 (void)
+int ZIBGetPort16 (int BaseAdr)
 {
-   return ((ZIBGetPort8 (1) << 8) + ZIBGetPort8 (0));
+   return ((ZIBGetPort8 (BaseAdr, 1) << 8) + ZIBGetPort8 (BaseAdr, 0));
 }
 
 
@@ -257,14 +259,14 @@ int ZIBGetPort16 (void)
 /* Setzt die beiden 8-Bit-Ports der Digitalausgabe auf den Wert 'SetTo'    */
 /* Erst wird das niederwertige, dann das hherwertige Byte ausgegeben!     */
 /*                                                                         */
-/* Aufruf:          ZIBSetPort16 (abcd);                                   */
-/*                  ZIBSetPort16 (0x1234);                                 */
+/* Aufruf:          ZIBSetPort16 (adr, abcd);                              */
+/*                  ZIBSetPort16 (ZIBBaseAdr, 0x1234);                     */
 /*                                                                         */
 /***************************************************************************/
-void ZIBSetPort16 (int SetTo)
+void ZIBSetPort16 (int BaseAdr, int SetTo)
 {
-   ZIBSetPort8 (1, SetTo >> 8);  		/* hherwertiges Byte 	   */
-   ZIBSetPort8 (0, SetTo && 256);  		/* niederwertiges Byte     */
+   ZIBSetPort8 (BaseAdr, 1, SetTo >> 8);  		/* hherwertiges Byte 	   */
+   ZIBSetPort8 (BaseAdr, 0, SetTo && 256);  		/* niederwertiges Byte     */
 }
 
 
@@ -282,21 +284,21 @@ void ZIBSetPort16 (int SetTo)
 /* Digital-Ausgabe: Kanal 0 auf 0x00                                       */
 /*                  Kanal 1 auf 0x00                                       */
 /*                                                                         */
-/* Aufruf:          ZIBInit ();                                            */
+/* Aufruf:          ZIBInit (adr);                                         */
 /*                                                                         */
 /***************************************************************************/
-void ZIBInit (void)
+void ZIBInit (int BaseAdr)
 {
-  ZIBInitCounter (0, Vierfach, 0);		/* Zhler initialisieren   */
-  ZIBSetCounter  (0, 0);			/* Zhler auf 0 setzen     */
-  ZIBInitCounter (1, Vierfach, 0);
-  ZIBSetCounter  (1, 0);
-  ZIBInitCounter (2, Vierfach, 0);
-  ZIBSetCounter  (2, 0);
-  ZIBInitCounter (3, Vierfach, 0);
-  ZIBSetCounter  (3, 0);
-
-  ZIBSetPort16 (0);				/* Digitalausgabe setzen   */
+  ZIBInitCounter (BaseAdr, 0, Vierfach, 0);		/* Zhler initialisieren   */
+  ZIBSetCounter  (BaseAdr, 0, 0);			/* Zhler auf 0 setzen     */
+  ZIBInitCounter (BaseAdr, 1, Vierfach, 0);
+  ZIBSetCounter  (BaseAdr, 1, 0);
+  ZIBInitCounter (BaseAdr, 2, Vierfach, 0);
+  ZIBSetCounter  (BaseAdr, 2, 0);
+  ZIBInitCounter (BaseAdr, 3, Vierfach, 0);
+  ZIBSetCounter  (BaseAdr, 3, 0);
+
+  ZIBSetPort16 (BaseAdr, 0);				/* Digitalausgabe setzen   */
 }
 
 /***************************************************************************/